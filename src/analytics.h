@@ -0,0 +1,129 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <cstdint>
+#include <pqxx/pqxx>
+#include <nlohmann/json.hpp>
+#include "db_pool.h"
+#include "server_config.h"
+
+// Per-user rollups are kept in the same transaction as the balance change, so a summary
+// is a range read over at most `limit` buckets instead of a GROUP BY over the whole history.
+// Every operation is added to its day, week and month bucket.
+
+inline const std::string ROLLUP_PERIODS = "unnest(ARRAY['day', 'week', 'month']) AS p(period)";
+
+inline void ensure_analytics_schema(pqxx::work& work) {
+	work.exec("CREATE TABLE IF NOT EXISTS spending_rollups (user_id INT NOT NULL, period TEXT NOT NULL, bucket DATE NOT NULL, inflow BIGINT NOT NULL DEFAULT 0, outflow BIGINT NOT NULL DEFAULT 0, jar_deposits BIGINT NOT NULL DEFAULT 0, jar_withdrawals BIGINT NOT NULL DEFAULT 0, tx_count INT NOT NULL DEFAULT 0, PRIMARY KEY (user_id, period, bucket))");
+	work.exec("CREATE TABLE IF NOT EXISTS counterparty_rollups (user_id INT NOT NULL, counterparty_id INT NOT NULL, inflow BIGINT NOT NULL DEFAULT 0, outflow BIGINT NOT NULL DEFAULT 0, tx_count INT NOT NULL DEFAULT 0, PRIMARY KEY (user_id, counterparty_id))");
+	work.exec("CREATE INDEX IF NOT EXISTS counterparty_rollups_total_idx ON counterparty_rollups (user_id, (inflow + outflow) DESC)");
+}
+
+// Only the backfill scans transactions by sender and receiver. The indexes are built concurrently,
+// outside of a transaction, so live transfers are not blocked while they are built.
+inline void ensure_backfill_indexes(pqxx::connection& connection) {
+	pqxx::nontransaction work(connection);
+	work.exec("CREATE INDEX CONCURRENTLY IF NOT EXISTS transactions_sender_id_idx ON transactions (sender_id)");
+	work.exec("CREATE INDEX CONCURRENTLY IF NOT EXISTS transactions_receiver_id_idx ON transactions (receiver_id)");
+}
+
+inline void record_transfer(pqxx::work& work, int sender_id, int receiver_id, int64_t amount) {
+	work.exec_params("INSERT INTO spending_rollups (user_id, period, bucket, inflow, outflow, tx_count) SELECT f.user_id, p.period, date_trunc(p.period, now())::date, f.inflow, f.outflow, 1 FROM (VALUES ($1::int, 0::bigint, $3::bigint), ($2::int, $3::bigint, 0::bigint)) AS f(user_id, inflow, outflow) CROSS JOIN " + ROLLUP_PERIODS + " ON CONFLICT (user_id, period, bucket) DO UPDATE SET inflow = spending_rollups.inflow + EXCLUDED.inflow, outflow = spending_rollups.outflow + EXCLUDED.outflow, tx_count = spending_rollups.tx_count + 1", sender_id, receiver_id, amount);
+	work.exec_params("INSERT INTO counterparty_rollups (user_id, counterparty_id, inflow, outflow, tx_count) VALUES ($1, $2, 0, $3, 1), ($2, $1, $3, 0, 1) ON CONFLICT (user_id, counterparty_id) DO UPDATE SET inflow = counterparty_rollups.inflow + EXCLUDED.inflow, outflow = counterparty_rollups.outflow + EXCLUDED.outflow, tx_count = counterparty_rollups.tx_count + 1", sender_id, receiver_id, amount);
+}
+
+inline void record_jar_operation(pqxx::work& work, int user_id, int64_t deposited, int64_t withdrawn) {
+	work.exec_params("INSERT INTO spending_rollups (user_id, period, bucket, jar_deposits, jar_withdrawals) SELECT $1::int, p.period, date_trunc(p.period, now())::date, $2::bigint, $3::bigint FROM " + ROLLUP_PERIODS + " ON CONFLICT (user_id, period, bucket) DO UPDATE SET jar_deposits = spending_rollups.jar_deposits + EXCLUDED.jar_deposits, jar_withdrawals = spending_rollups.jar_withdrawals + EXCLUDED.jar_withdrawals", user_id, deposited, withdrawn);
+}
+
+// Rebuilds the transfer part of the rollups for users in [first_id, last_id].
+// The bank rows of the chunk are locked first, so live transfers of these users wait for the chunk
+// and the rebuild sees every committed transaction. Jar operations have no history table,
+// so their columns are left as they are.
+inline void backfill_analytics_chunk(pqxx::work& work, int64_t first_id, int64_t last_id) {
+	work.exec_params("SELECT id FROM bank WHERE id BETWEEN $1 AND $2 ORDER BY id FOR UPDATE", first_id, last_id);
+	work.exec_params("UPDATE spending_rollups SET inflow = 0, outflow = 0, tx_count = 0 WHERE user_id BETWEEN $1 AND $2", first_id, last_id);
+	work.exec_params("INSERT INTO spending_rollups (user_id, period, bucket, inflow, outflow, tx_count) SELECT e.user_id, p.period, date_trunc(p.period, e.transactions_time)::date, SUM(e.inflow)::bigint, SUM(e.outflow)::bigint, COUNT(*) FROM (SELECT receiver_id AS user_id, transactions_time, amount AS inflow, 0::bigint AS outflow FROM transactions WHERE receiver_id BETWEEN $1 AND $2 UNION ALL SELECT sender_id, transactions_time, 0::bigint, amount FROM transactions WHERE sender_id BETWEEN $1 AND $2) AS e CROSS JOIN " + ROLLUP_PERIODS + " GROUP BY 1, 2, 3 ON CONFLICT (user_id, period, bucket) DO UPDATE SET inflow = EXCLUDED.inflow, outflow = EXCLUDED.outflow, tx_count = EXCLUDED.tx_count", first_id, last_id);
+	work.exec_params("DELETE FROM counterparty_rollups WHERE user_id BETWEEN $1 AND $2", first_id, last_id);
+	work.exec_params("INSERT INTO counterparty_rollups (user_id, counterparty_id, inflow, outflow, tx_count) SELECT e.user_id, e.counterparty_id, SUM(e.inflow)::bigint, SUM(e.outflow)::bigint, COUNT(*) FROM (SELECT receiver_id AS user_id, sender_id AS counterparty_id, amount AS inflow, 0::bigint AS outflow FROM transactions WHERE receiver_id BETWEEN $1 AND $2 UNION ALL SELECT sender_id, receiver_id, 0::bigint, amount FROM transactions WHERE sender_id BETWEEN $1 AND $2) AS e GROUP BY 1, 2", first_id, last_id);
+}
+
+// Runs the backfill over all users in chunks of "analytics.backfill_chunk_size" ids,
+// processed by "analytics.backfill_threads" threads with one connection each.
+inline int backfill_analytics(const std::string& config) {
+	std::ifstream file(config);
+	if (!file.is_open()) {
+		throw std::runtime_error("Config file not open");
+	}
+
+	nlohmann::json data = nlohmann::json::parse(file);
+	nlohmann::json analytics_config = data.value("analytics", nlohmann::json::object());
+	int64_t hardware_threads = available_cpus();
+	size_t threads_count = read_config_int(analytics_config, "backfill_threads", hardware_threads, 1, 4 * hardware_threads);
+	int chunk_size = static_cast<int>(read_config_int(analytics_config, "backfill_chunk_size", 1000, 1, INT32_MAX));
+
+	int max_id = 0;
+	{
+		pqxx::connection connection = open_connection(config);
+		{
+			pqxx::work work(connection);
+			ensure_analytics_schema(work);
+			max_id = work.exec("SELECT COALESCE(MAX(id), 0) FROM bank")[0][0].as<int>();
+			work.commit();
+		}
+		ensure_backfill_indexes(connection);
+	}
+
+	ConnectionPool pool(config, threads_count);
+	if (pool.size() == 0) {
+		throw std::runtime_error("Failed to open any database connection for the analytics backfill");
+	}
+
+	int chunks_count = max_id / chunk_size + 1;
+	std::atomic<int> next_chunk{ 0 };
+	std::atomic<int> failed_chunks{ 0 };
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < threads_count; ++i) {
+		threads.emplace_back([&]() {
+			for (int chunk = next_chunk++; chunk < chunks_count; chunk = next_chunk++) {
+				int64_t first_id = static_cast<int64_t>(chunk) * chunk_size;
+				int64_t last_id = first_id + chunk_size - 1;
+				bool done = false;
+
+				for (int attempt = 0; attempt < 3 && !done; ++attempt) {
+					try {
+						DatabaseConnection database(pool);
+						pqxx::work work(database.get());
+						backfill_analytics_chunk(work, first_id, last_id);
+						work.commit();
+						done = true;
+					}
+					catch (const pqxx::transaction_rollback& e) {
+						std::cerr << "Retrying analytics chunk " << first_id << "-" << last_id << ": " << e.what() << std::endl;
+					}
+					catch (const std::exception& e) {
+						std::cerr << "Exception: " << e.what() << std::endl;
+						break;
+					}
+				}
+
+				if (!done) {
+					++failed_chunks;
+				}
+			}
+			});
+	}
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	std::cerr << "Analytics backfill: " << chunks_count - failed_chunks << " of " << chunks_count << " chunks done" << std::endl;
+	return failed_chunks == 0 ? 0 : 1;
+}
@@ -9,6 +9,22 @@
 #include <pqxx/pqxx>
 #include <nlohmann/json.hpp>
 
+inline std::string make_connection_string(const nlohmann::json& database_config) {
+	return "host=" + database_config["host"].get<std::string>() + " port=" + std::to_string(database_config["port"].get<int>()) + " dbname=" + database_config["dbname"].get<std::string>() + " user=" + database_config["user"].get<std::string>() + " password=" + database_config["password"].get<std::string>();
+}
+
+// Opens a single connection outside of any pool. Unlike ConnectionPool it throws when
+// the database is unreachable, so one-off startup steps fail instead of waiting forever.
+inline pqxx::connection open_connection(const std::string& config) {
+	std::ifstream file(config);
+	if (!file.is_open()) {
+		throw std::runtime_error("Config file not open");
+	}
+
+	nlohmann::json data = nlohmann::json::parse(file);
+	return pqxx::connection(make_connection_string(data["database"]));
+}
+
 class ConnectionPool {
 private:
 	std::queue<std::shared_ptr<pqxx::connection>> connections;
@@ -17,7 +33,7 @@ private:
 	size_t pool_size;
 
 public:
-	ConnectionPool(const std::string& config) {
+	ConnectionPool(const std::string& config, size_t size = 0) {
 		std::ifstream file(config);
 		if (!file.is_open()) {
 			throw std::runtime_error("Config file not open");
@@ -26,8 +42,8 @@ public:
 		nlohmann::json data = nlohmann::json::parse(file);
 		auto database_config = data["database"];
 
-		std::string connection_string = "host=" + database_config["host"].get<std::string>() + " port=" + std::to_string(database_config["port"].get<int>()) + " dbname=" + database_config["dbname"].get<std::string>() + " user=" + database_config["user"].get<std::string>() + " password=" + database_config["password"].get<std::string>();
-		pool_size = database_config["pool_size"].get<int>();
+		std::string connection_string = make_connection_string(database_config);
+		pool_size = size > 0 ? size : database_config["pool_size"].get<int>();
 
 		for (size_t i = 0; i < pool_size; ++i) {
 			try {
@@ -43,6 +59,11 @@ public:
 				std::cerr << "Exception: " << e.what() << std::endl;
 			}
 		}
+		pool_size = connections.size();
+	}
+
+	size_t size() const {
+		return pool_size;
 	}
 
 	std::shared_ptr<pqxx::connection> get_connection() {
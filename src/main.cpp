@@ -2,6 +2,10 @@
 #include "db_pool.h"
 #include "crow.h"
 #include "course.h"
+#include "server_config.h"
+#include "analytics.h"
+#include <charconv>
+#include <string_view>
 #include <jwt-cpp/jwt.h>
 #include <jwt-cpp/traits/nlohmann-json/traits.h>
 
@@ -27,9 +31,30 @@ int get_current_user_id(const crow::request& request) {
 	}
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 	try {
-		ConnectionPool pool("config.json");
+		if (argc > 1 && std::string(argv[1]) == "--backfill-analytics") {
+			return backfill_analytics("config.json");
+		}
+
+		ServerConfig server_config = ServerConfig::load("config.json");
+		{
+			pqxx::connection connection = open_connection("config.json");
+			pqxx::work work(connection);
+			ensure_analytics_schema(work);
+			work.commit();
+		}
+
+		std::optional<size_t> process_index = spawn_processes(server_config);
+		if (!process_index) {
+			return wait_for_processes();
+		}
+		pin_to_cpus(server_config, *process_index);
+
+		ConnectionPool pool("config.json", server_config.pool_size);
+		if (pool.size() < server_config.pool_size) {
+			throw std::runtime_error("Opened " + std::to_string(pool.size()) + " of " + std::to_string(server_config.pool_size) + " database connections");
+		}
 		crow::SimpleApp app;
 
 		CROW_ROUTE(app, "/users").methods("POST"_method) ([&pool](const crow::request& request) {
@@ -162,6 +187,7 @@ int main() {
 				work.exec_params("UPDATE bank SET balance = balance - $1 WHERE id = $2", amount, sender_id);
 				work.exec_params("UPDATE bank SET balance = balance + $1 WHERE id = $2", amount, receiver_id);
 				work.exec_params("INSERT INTO transactions (sender_id, receiver_id, amount) VALUES ($1, $2, $3)", sender_id, receiver_id, amount);
+				record_transfer(work, sender_id, receiver_id, amount);
 				work.commit();
 				return crow::response(200, "Transfer successful");
 
@@ -273,6 +299,86 @@ int main() {
 			}
 			});
 
+		CROW_ROUTE(app, "/analytics").methods("GET"_method) ([&pool](const crow::request& request) {
+			int user_id = get_current_user_id(request);
+
+			if (user_id == -1) {
+				return crow::response(401, "Unauthorized: Invalid token");
+			}
+
+			std::string period = request.url_params.get("period") ? request.url_params.get("period") : "month";
+			if (period != "day" && period != "week" && period != "month") {
+				return crow::response(400, "Period must be day, week or month");
+			}
+
+			int limit = 12;
+			if (request.url_params.get("limit")) {
+				std::string_view limit_param = request.url_params.get("limit");
+				auto [end, error] = std::from_chars(limit_param.data(), limit_param.data() + limit_param.size(), limit);
+				if (error != std::errc() || end != limit_param.data() + limit_param.size()) {
+					return crow::response(400, "Limit must be between 1 and 366");
+				}
+			}
+			if (limit <= 0 || limit > 366) {
+				return crow::response(400, "Limit must be between 1 and 366");
+			}
+
+			try {
+				DatabaseConnection database(pool);
+				pqxx::work work(database.get());
+				int target_id = user_id;
+
+				if (request.url_params.get("username")) {
+					pqxx::result result = work.exec_params("SELECT access_rights FROM bank WHERE id = $1", user_id);
+					std::string access_rights_user = result[0]["access_rights"].c_str();
+
+					if (access_rights_user != "admin") {
+						return crow::response(403, "You do not have sufficient rights to perform this action");
+					}
+
+					pqxx::result check_target = work.exec_params("SELECT id FROM bank WHERE username = $1", std::string(request.url_params.get("username")));
+
+					if (check_target.empty()) {
+						return crow::response(404, "User with this username not found");
+					}
+					target_id = check_target[0]["id"].as<int>();
+				}
+
+				pqxx::result summary = work.exec_params("SELECT TO_CHAR(bucket, 'DD.MM.YYYY') AS bucket, inflow, outflow, jar_deposits, jar_withdrawals, tx_count FROM spending_rollups WHERE user_id = $1 AND period = $2 ORDER BY bucket DESC LIMIT $3", target_id, period, limit);
+				std::vector<crow::json::wvalue> summary_list;
+				for (const auto& row : summary) {
+					crow::json::wvalue bucket;
+					bucket["bucket"] = row["bucket"].c_str();
+					bucket["inflow"] = row["inflow"].as<int64_t>();
+					bucket["outflow"] = row["outflow"].as<int64_t>();
+					bucket["jar_deposits"] = row["jar_deposits"].as<int64_t>();
+					bucket["jar_withdrawals"] = row["jar_withdrawals"].as<int64_t>();
+					bucket["transactions"] = row["tx_count"].as<int>();
+					summary_list.push_back(bucket);
+				}
+
+				pqxx::result counterparties = work.exec_params("SELECT b.username, c.inflow, c.outflow, c.tx_count FROM counterparty_rollups c JOIN bank b ON c.counterparty_id = b.id WHERE c.user_id = $1 ORDER BY c.inflow + c.outflow DESC LIMIT 5", target_id);
+				std::vector<crow::json::wvalue> counterparties_list;
+				for (const auto& row : counterparties) {
+					crow::json::wvalue counterparty;
+					counterparty["username"] = row["username"].c_str();
+					counterparty["inflow"] = row["inflow"].as<int64_t>();
+					counterparty["outflow"] = row["outflow"].as<int64_t>();
+					counterparty["transactions"] = row["tx_count"].as<int>();
+					counterparties_list.push_back(counterparty);
+				}
+
+				crow::json::wvalue response_body;
+				response_body["period"] = period;
+				response_body["summary"] = std::move(summary_list);
+				response_body["top_counterparties"] = std::move(counterparties_list);
+				return crow::response(200, response_body);
+			}
+			catch (const std::exception& e) {
+				return crow::response(500, std::string("Exception: ") + e.what());
+			}
+			});
+
 		CROW_ROUTE(app, "/jars").methods("GET"_method) ([&pool](const crow::request& request) {
 			int user_id = get_current_user_id(request);
 
@@ -393,6 +499,7 @@ int main() {
 
 					work.exec_params("UPDATE jars SET jar_balance = jar_balance - $1 WHERE user_id = $2 AND id = $3", amount, user_id, jar_id);
 					work.exec_params("UPDATE bank SET balance = balance + $1 WHERE id = $2", amount, user_id);
+					record_jar_operation(work, user_id, 0, amount);
 				}
 				else if (type == "deposit") {
 					pqxx::result check_balance = work.exec_params("SELECT balance FROM bank WHERE id = $1", user_id);
@@ -404,6 +511,7 @@ int main() {
 
 					work.exec_params("UPDATE jars SET jar_balance = jar_balance + $1 WHERE user_id = $2 AND id = $3", amount, user_id, jar_id);
 					work.exec_params("UPDATE bank SET balance = balance - $1 WHERE id = $2", amount, user_id);
+					record_jar_operation(work, user_id, amount, 0);
 				}
 				else {
 					return crow::response(400, "Wrong method");
@@ -435,6 +543,9 @@ int main() {
 
 				work.exec_params("UPDATE bank SET balance = balance + $1 WHERE id = $2", current_jar_balance, user_id);
 				work.exec_params("DELETE FROM jars WHERE user_id = $1 AND id = $2", user_id, jar_id);
+				if (current_jar_balance > 0) {
+					record_jar_operation(work, user_id, 0, current_jar_balance);
+				}
 				work.commit();
 
 				return crow::response(200, "Jar deleted");
@@ -514,7 +625,7 @@ int main() {
 		}
 	});
 
-		app.port(18080).multithreaded().run();
+		app.port(static_cast<uint16_t>(server_config.port + *process_index)).concurrency(server_config.workers).run();
 	}
 	catch (std::exception& e) {
 		std::cerr << "Exception: " << e.what() << std::endl;
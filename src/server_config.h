@@ -0,0 +1,239 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <optional>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <cstdint>
+#include <cerrno>
+#include <csignal>
+#include <nlohmann/json.hpp>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Reads an optional integer setting as a signed value, so a typo like -1 is rejected
+// instead of wrapping around when it is converted to size_t.
+inline int64_t read_config_int(const nlohmann::json& section, const std::string& name, int64_t fallback, int64_t min, int64_t max) {
+	if (!section.contains(name)) {
+		return fallback;
+	}
+	if (!section[name].is_number_integer() || section[name].get<int64_t>() < min || section[name].get<int64_t>() > max) {
+		throw std::runtime_error("Config error: \"" + name + "\" must be an integer between " + std::to_string(min) + " and " + std::to_string(max));
+	}
+	return section[name].get<int64_t>();
+}
+
+// Number of CPUs this process may run on. On Linux it is taken from the affinity mask,
+// which respects container and cgroup limits, unlike hardware_concurrency().
+inline int64_t available_cpus() {
+#ifdef __linux__
+	cpu_set_t allowed_set;
+	CPU_ZERO(&allowed_set);
+	if (sched_getaffinity(0, sizeof(allowed_set), &allowed_set) == 0) {
+		return std::max(1, CPU_COUNT(&allowed_set));
+	}
+#endif
+	return std::max<int64_t>(1, std::thread::hardware_concurrency());
+}
+
+struct ServerConfig {
+	uint16_t port = 18080;
+	size_t workers = 1;
+	size_t processes = 1;
+	bool cpu_affinity = false;
+	size_t pool_size = 1;
+
+	// Reads the optional "server" section of config.json. Every process gets `workers` Crow threads
+	// and a ConnectionPool of at least `workers` connections, so a handler never waits for the pool.
+	// "database.pool_size" is treated as the total budget and split between processes.
+	static ServerConfig load(const std::string& config) {
+		std::ifstream file(config);
+		if (!file.is_open()) {
+			throw std::runtime_error("Config file not open");
+		}
+
+		nlohmann::json data = nlohmann::json::parse(file);
+		nlohmann::json server_config = data.value("server", nlohmann::json::object());
+		ServerConfig result;
+
+		int64_t hardware_threads = available_cpus();
+		result.port = static_cast<uint16_t>(read_config_int(server_config, "port", result.port, 1, UINT16_MAX));
+		result.processes = read_config_int(server_config, "processes", 1, 1, hardware_threads);
+		if (result.port + result.processes - 1 > UINT16_MAX) {
+			throw std::runtime_error("Config error: \"port\" + \"processes\" - 1 must not exceed 65535");
+		}
+		int64_t default_workers = std::max<int64_t>(1, hardware_threads / static_cast<int64_t>(result.processes));
+		result.workers = read_config_int(server_config, "workers", default_workers, 1, UINT16_MAX);
+		result.cpu_affinity = server_config.value("cpu_affinity", false);
+
+		size_t total_pool_size = read_config_int(data["database"], "pool_size", 0, 0, INT32_MAX);
+		result.pool_size = std::max(total_pool_size / result.processes, result.workers);
+		return result;
+	}
+};
+
+#ifndef _WIN32
+// Filled only while SIGINT/SIGTERM are blocked; the handler is installed after the fork loop,
+// so it never walks the vector while it is being resized. Reaped children are set to 0
+// (also with the signals blocked), so a reused pid is never killed.
+inline std::vector<pid_t> child_processes;
+inline volatile std::sig_atomic_t stop_requested = 0;
+
+inline void stop_child_processes(int signal) {
+	stop_requested = 1;
+	for (pid_t child : child_processes) {
+		if (child > 0) {
+			kill(child, signal);
+		}
+	}
+}
+
+inline void forget_child_process(pid_t pid) {
+	sigset_t stop_signals;
+	sigset_t previous_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &stop_signals, &previous_mask);
+	std::replace(child_processes.begin(), child_processes.end(), pid, pid_t{ 0 });
+	sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+}
+#endif
+
+// Forks `processes` copies of the server and returns the index of the current child.
+// The parent gets std::nullopt and should call wait_for_processes().
+// Crow does not expose its acceptor, so SO_REUSEPORT cannot be set on it; child `i` listens on
+// `port + i` instead and the processes are meant to sit behind a balancer (e.g. an nginx upstream).
+inline std::optional<size_t> spawn_processes(const ServerConfig& config) {
+	if (config.processes <= 1) {
+		return 0;
+	}
+#ifdef _WIN32
+	std::cerr << "Multi-process mode is not supported on Windows, running a single process" << std::endl;
+	return 0;
+#else
+	sigset_t stop_signals;
+	sigset_t previous_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &stop_signals, &previous_mask);
+	child_processes.reserve(config.processes);
+
+	for (size_t i = 0; i < config.processes; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			stop_child_processes(SIGTERM);
+			sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+			throw std::runtime_error("Failed to fork server process");
+		}
+		if (pid == 0) {
+			child_processes.clear();
+			sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+			return i;
+		}
+		child_processes.push_back(pid);
+	}
+
+	std::signal(SIGINT, stop_child_processes);
+	std::signal(SIGTERM, stop_child_processes);
+	sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+	return std::nullopt;
+#endif
+}
+
+// Waits for all children started by spawn_processes(). Crashed children are not restarted:
+// the first child that exits before a shutdown was requested (or with a non-zero status, or
+// by an unexpected signal) makes the supervisor SIGTERM the others, reap them and return 1,
+// so systemd or docker can restart the whole server.
+inline int wait_for_processes() {
+	int exit_code = 0;
+#ifndef _WIN32
+	for (size_t running = child_processes.size(); running > 0;) {
+		int status = 0;
+		pid_t pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		forget_child_process(pid);
+		--running;
+
+		bool expected = stop_requested != 0;
+		if (WIFEXITED(status)) {
+			if (WEXITSTATUS(status) != 0) {
+				std::cerr << "Error! Server process " << pid << " exited with code " << WEXITSTATUS(status) << std::endl;
+				expected = false;
+			}
+			else if (!expected) {
+				std::cerr << "Error! Server process " << pid << " stopped unexpectedly" << std::endl;
+			}
+		}
+		else if (WIFSIGNALED(status)) {
+			int signal = WTERMSIG(status);
+			if (signal != SIGINT && signal != SIGTERM) {
+				expected = false;
+			}
+			if (!expected) {
+				std::cerr << "Error! Server process " << pid << " was killed by signal " << signal << std::endl;
+			}
+		}
+
+		if (!expected && exit_code == 0) {
+			exit_code = 1;
+			if (running > 0) {
+				std::cerr << "Stopping the remaining server processes" << std::endl;
+				stop_child_processes(SIGTERM);
+			}
+		}
+	}
+#endif
+	return exit_code;
+}
+
+// Pins the calling thread before Crow starts, so every worker thread it spawns inherits the mask.
+// Process `i` gets the i-th group of `workers` CPUs from the set the process is allowed to run on
+// (which may be limited by a container or cgroup), wrapped around that set.
+inline void pin_to_cpus(const ServerConfig& config, size_t process_index) {
+	if (!config.cpu_affinity) {
+		return;
+	}
+#ifdef __linux__
+	cpu_set_t allowed_set;
+	CPU_ZERO(&allowed_set);
+	if (sched_getaffinity(0, sizeof(allowed_set), &allowed_set) != 0) {
+		std::cerr << "Error! Failed to read CPU affinity" << std::endl;
+		return;
+	}
+
+	std::vector<int> allowed_cpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &allowed_set)) {
+			allowed_cpus.push_back(cpu);
+		}
+	}
+	if (allowed_cpus.empty()) {
+		return;
+	}
+
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (size_t i = 0; i < config.workers; ++i) {
+		CPU_SET(allowed_cpus[(process_index * config.workers + i) % allowed_cpus.size()], &cpu_set);
+	}
+	if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+		std::cerr << "Error! Failed to set CPU affinity" << std::endl;
+	}
+#else
+	std::cerr << "CPU affinity is only supported on Linux" << std::endl;
+#endif
+}